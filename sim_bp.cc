@@ -3,8 +3,26 @@
 #include <string.h>
 #include <cmath>
 #include <inttypes.h>
+#include <vector>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <glob.h>
+#include <algorithm>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include "sim_bp.h"
 
+#if defined(__GNUC__)
+#define HOT_PATH inline __attribute__((always_inline))     // per-branch kernels, inlined into every trace loop
+#else
+#define HOT_PATH inline
+#endif
+
 // prediction statistics
 
 class prediction_stats
@@ -21,158 +39,216 @@ class prediction_stats
 };
 
 
-// bimodal branch predictor 
+// table of saturating counters; the hot path uses the kernels specialized on the counter kind COUNTER,
+// the width plus COUNTER_STEPPED when inc/dec are not both 1. Unit-step counters (the default) take a
+// byte each and update with saturating arithmetic; stepped counters are packed 32/WIDTH to a word
+// (3-bit counters in 4-bit slots so that none straddles a word) and update through a transition table
 
-class bimodal_branch_predictor
-{ 
+class counter_table
+{
 
-private: 
+private:
 
-    size_t *branch_table;
+    uint32_t *words;
+    size_t word_count;
+    unsigned slot;                                                      // bits per counter: 8 for unit steps, else packed
+    uint8_t transition[4 << COUNTER_MAX_BITS];                          // next value, indexed by value | up << width | down << (width + 1)
 
+public:
 
-public: 
+    counter_params config;
 
-    char bimodal_prediction;                                                           // stores the bimodal prediction
-    prediction_stats m_stats;
+    counter_table(size_t entries, const counter_params &counters)
+    {
 
+        config = counters;
+        slot = slot_bits(config);
+        word_count = (entries * slot + 31) / 32;
 
-    // constructor to initialize the branch history table
+        words = new uint32_t[word_count];
 
-    bimodal_branch_predictor(size_t m)
-    {
+        unsigned long max = (1ul << config.width) - 1;
+
+        for(unsigned long value = 0; value <= max; value++)             // saturating steps of config.inc / config.dec
+        {
+            transition[value] = value;
+            transition[value | (1 << config.width)] = (value + config.inc > max) ? max : value + config.inc;
+            transition[value | (2 << config.width)] = (value < config.dec) ? 0 : value - config.dec;
+            transition[value | (3 << config.width)] = value;            // never both
+        }
 
-        size_t index_width;
+        reset();
 
-        index_width = pow(2, m);
+    }
 
-        branch_table = new size_t[index_width];                                  // dynamically allocate a branch table to update the predictions
+    ~counter_table()
+    {
+        delete[] words;
+    }
 
-        for(size_t i=0; i < index_width; i++)
+    static unsigned slot_bits(const counter_params &counters)
+    {
+        if((counters.inc == 1) && (counters.dec == 1))
         {
+            return 8;
+        }
+
+        return (counters.width == 3) ? 4 : counters.width;
+    }
+
+    void reset()                                                        // every counter back to config.init
+    {
+
+        uint32_t pattern = 0;
 
-            branch_table[i] = 2;                                                // initialize all the bimodal counters to 2 ("weakly taken")
+        for(unsigned shift = 0; shift < 32; shift += slot)
+        {
+            pattern |= uint32_t(config.init) << shift;
+        }
 
+        for(size_t i = 0; i < word_count; i++)
+        {
+            words[i] = pattern;
         }
 
     }
 
-    virtual ~bimodal_branch_predictor()                                         // deconstructor 
-
+    uint32_t counter(size_t index)                                      // any width, for printing the contents
     {
-        delete[] branch_table;
-    } 
 
-    uint32_t index_bimodal(uint32_t addr, size_t m)                            // calculates the index based on 'M2' lower pc bits
-    {
+        if(slot == 8)
+        {
+            return ((uint8_t *) words)[index];
+        }
 
-        return ((addr >> 2) & ((1 << m) - 1));
+        size_t bit = index * slot;
+
+        return (words[bit >> 5] >> (bit & 31)) & ((1u << config.width) - 1);
 
     }
 
-    virtual void predict(uint32_t addr, size_t m)                               // bimodal prediction algorithm
+    template<unsigned COUNTER>
+    uint32_t predict(uint32_t index)                                    // 1 (taken / gshare) in the upper half of the range
     {
 
-        m_stats.m_predictions_bimodal++ ;                              // increment the number of predictions (i.e., number of dynamic branches in the trace)
+        const unsigned WIDTH = COUNTER & (COUNTER_STEPPED - 1);
+        const unsigned SLOT = (WIDTH == 3) ? 4 : WIDTH;
+        const unsigned PER_WORD_LOG = (SLOT == 1) ? 5 : (SLOT == 2) ? 4 : 3;
 
-        uint32_t index = index_bimodal(addr, m);                      // returns the index for mapping the branch history table
-
-        switch(branch_table[index])                                  // make a prediction according to the given state
+        if(!(COUNTER & COUNTER_STEPPED))
         {
-            case 3: 
+            return ((uint8_t *) words)[index] >> (WIDTH - 1);
+        }
 
-                bimodal_prediction = 't';
+        uint32_t value = words[index >> PER_WORD_LOG] >> ((index & ((1u << PER_WORD_LOG) - 1)) * SLOT);
 
-            break;
+        return (value >> (WIDTH - 1)) & 1;
 
-            case 2:
+    }
 
-                bimodal_prediction = 't';
+    template<unsigned COUNTER>
+    void update(uint32_t index, uint32_t up, uint32_t down)            // saturating +inc when up, -dec when down
+    {
 
-            break;
+        const unsigned WIDTH = COUNTER & (COUNTER_STEPPED - 1);
+        const uint32_t MAX = (1u << WIDTH) - 1;
+        const unsigned SLOT = (WIDTH == 3) ? 4 : WIDTH;
+        const unsigned PER_WORD_LOG = (SLOT == 1) ? 5 : (SLOT == 2) ? 4 : 3;
 
-            case 1:
+        if(!(COUNTER & COUNTER_STEPPED))                                // unit steps: plain saturating arithmetic on a byte
+        {
+            uint8_t &cell = ((uint8_t *) words)[index];
+            uint32_t value = cell;
 
-                bimodal_prediction = 'n';
-                
-            break;
+            value += up & uint32_t(value != MAX);
+            value -= down & uint32_t(value != 0);
+            cell = value;
 
-            case 0:
+            return;
+        }
 
-                bimodal_prediction = 'n';
+        uint32_t &word = words[index >> PER_WORD_LOG];
+        unsigned shift = (index & ((1u << PER_WORD_LOG) - 1)) * SLOT;
+        uint32_t value = (word >> shift) & MAX;
 
-            break;
+        value = transition[value | (up << WIDTH) | (down << (WIDTH + 1))];
 
-        }
-        
+        word = (word & ~(MAX << shift)) | (value << shift);
 
     }
 
-    char get_bimodal_prediction ()
+    static size_t storage_bits(size_t entries, size_t width)            // modeled hardware storage
     {
-
-        return bimodal_prediction;
-
+        return entries * width;
     }
 
-    virtual void update_branch_table(uint32_t addr, size_t m, char outcome)     // update the branch history table based on the actual outcome
+    size_t resident_bytes()                                             // simulator memory: object + counter storage
     {
+        return sizeof(*this) + word_count * sizeof(uint32_t);
+    }
 
-        uint32_t index = index_bimodal(addr, m);                               // returns the index for mapping the branch history table
+};
 
-            switch(branch_table[index])                                           
-            {
-                case 3: 
 
-                    if(outcome == 'n')
-                    {   
-                    branch_table[index] = branch_table[index] - 1;             // go to weakly taken state 
-                    m_stats.m_mispredictions_bimodal++;
-                    }
+// bimodal branch predictor 
 
-                    break;
+class bimodal_branch_predictor
+{ 
 
-                case 2:
+private: 
 
-                    if(outcome == 'n')
-                    {
-                    branch_table[index] = branch_table[index] - 1;             // go to weakly not taken state 
-                    m_stats.m_mispredictions_bimodal++;
-                    }
+    counter_table *branch_table;
 
-                    else branch_table[index] = branch_table[index] + 1;       // go to strongly taken state
 
-                    break;
+public: 
 
-                case 1:
+    prediction_stats m_stats;
 
-                    if(outcome == 'n')
-                    {
-                    branch_table[index] = branch_table[index] - 1;             // go to strongly not taken state 
 
-                    }
+    // constructor to initialize the branch history table
 
-                
-                    else
-                    {
-                    branch_table[index] = branch_table[index] + 1;            // go to weakly taken state 
+    bimodal_branch_predictor(size_t m, const counter_params &counters)
+    {
 
-                    m_stats.m_mispredictions_bimodal++;
-                    }    
+        branch_table = new counter_table(pow(2, m), counters);                 // dynamically allocate a branch table, all counters at counters.init ("weakly taken" by default)
 
-                    break;
+    }
 
-                case 0:
+    void reset()                                                                // back to the initial state, keeping the allocated table
+    {
 
-                    if(outcome == 't')
-                    {
-                    branch_table[index] = branch_table[index] + 1;           // go to weakly not taken state 
-                    m_stats.m_mispredictions_bimodal++;
-                    }
-                    break;
+        branch_table -> reset();
 
-        }
+        m_stats = prediction_stats();
+
+    }
+
+    virtual ~bimodal_branch_predictor()                                         // deconstructor 
+
+    {
+        delete branch_table;
+    } 
+
+    uint32_t index_bimodal(uint32_t addr, size_t m)                            // calculates the index based on 'M2' lower pc bits
+    {
+
+        return ((addr >> 2) & ((1 << m) - 1));
+
+    }
+
+    template<unsigned COUNTER>
+    uint32_t predict(uint32_t index)                                            // bimodal prediction: 1 (taken) in the upper half of the counter
+    {
+
+        return branch_table -> predict<COUNTER>(index);
+
+    }
+
+    template<unsigned COUNTER>
+    void update_branch_table(uint32_t index, uint32_t taken, uint32_t enable)  // saturating counter update, skipped when enable is 0
+    {
 
+        branch_table -> update<COUNTER>(index, enable & taken, enable & (taken ^ 1));
 
     }
 
@@ -183,11 +259,21 @@ public:
         for(size_t i=0; i < pow(2,m); i++)
         {
 
-            printf(" %zu      %zu\n", i, branch_table[i]);
+            printf(" %zu      %u\n", i, branch_table -> counter(i));
 
         }
     }
 
+    static size_t storage_bits(size_t m, size_t width)                         // modeled hardware storage: 2^M2 counters
+    {
+        return counter_table::storage_bits(size_t(1) << m, width);
+    }
+
+    size_t resident_bytes()                                                    // simulator memory: object + counter table
+    {
+        return sizeof(*this) + branch_table -> resident_bytes();
+    }
+
 
 };
 
@@ -199,39 +285,37 @@ class gshare_branch_predictor
 
 private: 
 
-    size_t *branch_table;
+    counter_table *branch_table;
 
 public: 
 
-    char gshare_prediction;                                             // stores the prediction for hybrid branch predictor
     prediction_stats m_stats;
-    size_t global_history_register = 0;                                // initialize the gloabl history register to 0
+    size_t global_history_register = 0;                                // speculative global history, used for the predictions
 
 
     // constructor to initialize the branch history table
 
-    gshare_branch_predictor(size_t m)
+    gshare_branch_predictor(size_t m, const counter_params &counters)
     {
 
-        size_t index_width;
+        branch_table = new counter_table(pow(2, m), counters);           // dynamically allocate a branch table, all counters at counters.init ("weakly taken" by default)
 
-        index_width = pow(2, m);
+    }
 
-        branch_table = new size_t[index_width];                            // dynamically allocate a branch table to update the predictions
-        
-        for(size_t i=0; i < index_width; i++)
-        {
+    void reset()                                                        // back to the initial state, keeping the allocated table
+    {
 
-            branch_table[i] = 2;                                         // initialize all the gshare counters to 2 ("weakly taken")
+        branch_table -> reset();
 
-        }
+        global_history_register = 0;
+        m_stats = prediction_stats();
 
     }
 
     virtual ~gshare_branch_predictor()                                  // deconstructor 
 
     {
-        delete[] branch_table;
+        delete branch_table;
     } 
 
     uint32_t index_gshare(uint32_t addr, size_t m, size_t n)           // calculates the index based on 'M1' lower pc bits and 'N' global history bits
@@ -245,127 +329,34 @@ public:
         return ((xor_result << (m-n)) | (M & ((1 << (m-n)) - 1)));
 
     }
-    
 
-    virtual void predict(uint32_t addr, size_t m, size_t n)        // gshare prediction algorithm
+    template<unsigned COUNTER>
+    uint32_t predict(uint32_t index)                                    // gshare prediction: 1 (taken) in the upper half of the counter
     {
 
-        m_stats.m_predictions_gshare++ ;                          // increment the number of predictions (i.e., number of dynamic branches in the trace)
-
-        uint32_t index = index_gshare(addr, m, n);               // returns the index for mapping the branch history table
-        
-        switch(branch_table[index])                             // make a prediction according to the given state
-        {
-            case 3:
-
-                gshare_prediction = 't';
-
-            break;
-
-            case 2:
-
-                gshare_prediction = 't';
-
-            break;
-
-            case 1:
-
-                gshare_prediction = 'n'; 
-
-            break;
-
-            case 0:
-
-                gshare_prediction = 'n';
-
-            break;
-
-        }
+        return branch_table -> predict<COUNTER>(index);
 
     }
 
-    char get_gshare_prediction ()
+    template<unsigned COUNTER>
+    void update_branch_table(uint32_t index, uint32_t taken, uint32_t enable)     // saturating counter update, skipped when enable is 0
     {
 
-        return gshare_prediction;
+        branch_table -> update<COUNTER>(index, enable & taken, enable & (taken ^ 1));
 
     }
 
-    virtual void update_branch_table(uint32_t addr, size_t m, size_t n, char outcome)    // update the branch history table based on the actual outcome
+    void update_global_history(size_t n, uint32_t taken)               // speculative update with a predicted outcome
     {
 
-        uint32_t index = index_gshare(addr, m, n);                       // returns the index for mapping the branch history table
-
-            switch(branch_table[index])                                           
-            {
-                case 3: 
-
-                    if(outcome == 'n')
-                    {   
-                    branch_table[index] = branch_table[index] - 1;     // go to weakly taken state 
-                    m_stats.m_mispredictions_gshare++;
-                    }
-
-                    break;
-
-                case 2:
-
-                    if(outcome == 'n')
-                    {
-                    branch_table[index] = branch_table[index] - 1;       // go to weakly not taken state 
-                    m_stats.m_mispredictions_gshare++;
-                    }
-
-                    else branch_table[index] = branch_table[index] + 1;    // go to strongly taken state
-
-                    break;
-
-                case 1:
-
-                    if(outcome == 'n')
-                    {
-                    branch_table[index] = branch_table[index] - 1;        // go to strongly not taken state 
-
-                    }
-
-                
-                    else
-                    {
-                    branch_table[index] = branch_table[index] + 1;       // go to weakly taken state 
-
-                    m_stats.m_mispredictions_gshare++;
-                    }    
-
-                    break;
-
-                case 0:
-
-                    if(outcome == 't')
-                    {
-                    branch_table[index] = branch_table[index] + 1;      // go to weakly not taken state 
-                    m_stats.m_mispredictions_gshare++;
-                    }
-                    break;
-
-        }
-
+        global_history_register = (global_history_register >> 1) | (size_t(taken) << (n-1));
 
     }
 
-    virtual void update_global_history(size_t n, char outcome)
+    void repair_global_history(size_t n, uint32_t taken)               // overwrite the newest (speculative) bit with the actual outcome
     {
 
-        size_t actual_outcome;
-
-        if(outcome == 't')
-        {
-            actual_outcome = 1;
-
-        }
-
-        else actual_outcome = 0;
-
-        global_history_register = (global_history_register >> 1) | (actual_outcome << (n-1));    // update the global history register 
+        global_history_register = (global_history_register & ~(size_t(1) << (n-1))) | (size_t(taken) << (n-1));
 
     }
 
@@ -376,11 +367,21 @@ public:
         for(size_t i=0; i < pow(2,m); i++)
         {
 
-            printf(" %zu      %zu\n", i, branch_table[i]);
+            printf(" %zu      %u\n", i, branch_table -> counter(i));
 
         }
     }
 
+    static size_t storage_bits(size_t m, size_t n, size_t width)    // modeled hardware storage: 2^M1 counters + N-bit global history register
+    {
+        return counter_table::storage_bits(size_t(1) << m, width) + n;
+    }
+
+    size_t resident_bytes()                     // simulator memory: object + counter table
+    {
+        return sizeof(*this) + branch_table -> resident_bytes();
+    }
+
 
 };
 
@@ -391,40 +392,36 @@ class hybrid_branch_predictor
 
 private: 
 
-    size_t *chooser_table;
+    counter_table *chooser_table;
   
 
 public: 
 
-    char hybrid_prediction;                                             // stores the prediction for hybrid branch predictor
-    size_t sel_gshare;
     prediction_stats m_stats;
 
 
     // constructor to initialize the branch history table
 
-    hybrid_branch_predictor(size_t k, size_t m1, size_t n, size_t m2)
+    hybrid_branch_predictor(size_t k, const counter_params &counters)
     {
 
-        size_t index_width;
-
-        index_width = pow(2, k);
+        chooser_table = new counter_table(pow(2, k), counters);      // dynamically allocate a chooser table, all counters at counters.init (1 by default)
 
-        chooser_table = new size_t[index_width];                     // dynamically allocate a branch table to update the predictions
+    }
 
-        for(size_t i=0; i < index_width; i++)
-        {
+    void reset()                                                    // back to the initial state, keeping the allocated table
+    {
 
-            chooser_table[i] = 1;                                   // initialize all the hybrid counters to 1
+        chooser_table -> reset();
 
-        }
+        m_stats = prediction_stats();
 
     }
 
     virtual ~hybrid_branch_predictor()                                         // deconstructor 
 
     {
-        delete[] chooser_table;
+        delete chooser_table;
     } 
 
     uint32_t index_hybrid(uint32_t addr, size_t k)                           // calculates the index based on 'k' lower pc bits
@@ -434,131 +431,1882 @@ public:
 
     }
 
-    virtual size_t select_predictor(uint32_t addr, size_t k, size_t m1, size_t n, size_t m2, char outcome)    // hybrid prediction algorithm
+    template<unsigned COUNTER>
+    uint32_t select_predictor(uint32_t index)                               // 1 selects gshare (upper half of the counter), 0 selects bimodal
+    {
+
+        return chooser_table -> predict<COUNTER>(index);
+
+    }
+
+    template<unsigned COUNTER>
+    void update_chooser_table(uint32_t index, uint32_t gshare_correct, uint32_t bimodal_correct)    // update the chooser table 
     {
 
-        m_stats.m_predictions_hybrid++ ;                // increment the number of predictions (i.e., number of dynamic branches in the trace)
+        chooser_table -> update<COUNTER>(index, gshare_correct & (bimodal_correct ^ 1), (gshare_correct ^ 1) & bimodal_correct);
+
+    }
+
 
-        uint32_t index = index_hybrid(addr, k);        // returns the index for mapping the branch history table
+    void print_hybrid_contents(size_t k)       // print the hybrid prediction contents
+    {
+        printf("FINAL CHOOSER CONTENTS\n");
 
-        switch(chooser_table[index])                  // update the branch history table based on the actual outcome
+        for(size_t i=0; i < pow(2,k); i++)
         {
-            case 3:                                  
 
-                sel_gshare = 1;                      // select gshare algorithm 
-                
-            break;
+            printf(" %zu      %u\n", i, chooser_table -> counter(i));
 
-            case 2:
+        }
+    }
 
-                sel_gshare = 1;                      // select gshare algorithm 
+    static size_t storage_bits(size_t k, size_t width)         // modeled hardware storage of the chooser alone: 2^K counters
+    {
+        return counter_table::storage_bits(size_t(1) << k, width);
+    }
 
-            break;
+    size_t resident_bytes()                     // simulator memory: object + chooser table
+    {
+        return sizeof(*this) + chooser_table -> resident_bytes();
+    }
 
-            case 1:
-                
-                sel_gshare = 0;                      // select bimodal algorithm 
-                
-            break;
+};
 
-            case 0:
 
-                sel_gshare = 0;                      // select bimodal algorithm 
+// trace reader: yields one (addr, outcome) pair per dynamic branch, from either a plain text
+// trace ("<hex pc> <t|n>" per line) or a compressed trace written by compress_trace();
+// the format is detected from the file header
 
-            break;
-            
+class trace_reader
+{
+
+private:
+
+    FILE *fp;
+    bool compressed;
+    bool terminated;                                                            // the format ends with an end token (not BPZ1)
+    bool ended;                                                                 // end token read and checked
 
+    unsigned char *buffer;                                                      // block of the compressed file read with fread()
+    size_t buffer_len;
+    size_t buffer_pos;
+
+    branch_record window[BPZ_WINDOW];                                           // last BPZ_WINDOW records, source of the repeat tokens
+    uint64_t window_pos;
+    uint32_t repeat_period;                                                     // repeat token currently being expanded
+    uint64_t repeat_count;
+
+    bool read_byte(unsigned char &byte)
+    {
+
+        if(buffer_pos == buffer_len)
+        {
+            buffer_len = fread(buffer, 1, BPZ_BUFFER, fp);
+            buffer_pos = 0;
+
+            if(buffer_len == 0)
+            {
+                return false;
+            }
         }
 
-        return sel_gshare;
-        
+        byte = buffer[buffer_pos++];
+
+        return true;
 
     }
 
-    virtual void predict(char outcome, char prediction_hybrid)
+    bool read_varint(uint64_t &value)
     {
 
-        if(outcome != prediction_hybrid)
+        unsigned char byte;
+        unsigned shift = 0;
+
+        value = 0;
+
+        do
         {
+            if(!read_byte(byte))
+            {
+                if(shift != 0)
+                {
+                    corrupt();                                                  // stream ended in the middle of a token
+                }
+                return false;
+            }
 
-            m_stats.m_mispredictions_hybrid++;                      // increment the mispredictions for hybrid predictor
+            value |= uint64_t(byte & 0x7f) << shift;
+            shift += 7;
 
-        }
+        } while((byte & 0x80) && (shift < 64));
 
+        return true;
 
     }
 
-    virtual void update_chooser_table(uint32_t addr,size_t k, char prediction_gshare, char prediction_bimodal, char outcome)    // update the chooser table 
+    void corrupt()
     {
-         
-        uint32_t index = index_hybrid(addr, k);
+        printf("Error: Corrupt compressed trace file %s\n", trace_file);
+        exit(EXIT_FAILURE);
+    }
 
-        bool gshare_correct, bimodal_correct;
+public:
 
-        gshare_correct = (prediction_gshare == outcome);                            // gshare prediction is correct
-        bimodal_correct = (prediction_bimodal == outcome);                          // bimodal prediction is correct
+    const char *trace_file;
 
-        if((gshare_correct) & (!bimodal_correct) & (chooser_table[index] < 3))
-        {
+    trace_reader()
+    {
+        fp = NULL;
+        compressed = false;
+        terminated = false;
+        ended = false;
+        buffer = new unsigned char[BPZ_BUFFER];
+        buffer_len = 0;
+        buffer_pos = 0;
+        window_pos = 0;
+        repeat_period = 0;
+        repeat_count = 0;
+        trace_file = NULL;
+    }
 
-            chooser_table[index] = chooser_table[index] + 1;
+    ~trace_reader()
+    {
+        close();
+        delete[] buffer;
+    }
 
-        }
+    bool open(const char *file)                                                 // open a trace file and detect its format
+    {
 
-        else if((!gshare_correct) & (bimodal_correct) & (chooser_table[index] > 0))
+        char magic[BPZ_MAGIC_LEN];
 
-        {
+        close();
 
-            chooser_table[index] = chooser_table[index] - 1;
+        trace_file = file;
+        fp = fopen(file, "rb");
 
+        if(fp == NULL)
+        {
+            return false;
         }
 
-        else
+        compressed = false;
+        terminated = false;
+        ended = false;
+
+        if(fread(magic, 1, BPZ_MAGIC_LEN, fp) == BPZ_MAGIC_LEN)
         {
+            terminated = (memcmp(magic, BPZ_MAGIC, BPZ_MAGIC_LEN) == 0);
+            compressed = terminated || (memcmp(magic, BPZ_MAGIC_V1, BPZ_MAGIC_LEN) == 0);
+        }
 
-            chooser_table[index] = chooser_table[index];
+        if(!compressed)
+        {
+            rewind(fp);                                                         // plain text trace, start over
         }
 
+        buffer_len = 0;
+        buffer_pos = 0;
+        window_pos = 0;
+        repeat_period = 0;
+        repeat_count = 0;
+
+        return true;
+
+    }
 
+    long bytes_read()                                                           // position in the underlying file
+    {
+        return ftell(fp);
     }
 
+    void close()
+    {
+        if(fp != NULL)
+        {
+            fclose(fp);
+            fp = NULL;
+        }
+    }
 
-    void print_hybrid_contents(size_t k)       // print the hybrid prediction contents
+    bool next(unsigned long &addr, char &outcome)                               // read the next branch, false at the end of the trace
     {
-        printf("FINAL CHOOSER CONTENTS\n");
 
-        for(size_t i=0; i < pow(2,k); i++)
+        if(!compressed)
         {
+            char str[2];
 
-            printf(" %zu      %zu\n", i, chooser_table[i]);
+            if(fscanf(fp, "%lx %1s", &addr, str) != 2)
+            {
+                return false;
+            }
 
+            outcome = str[0];
+
+            return true;
         }
-    }
 
-};
+        branch_record record;
 
+        if(repeat_count == 0)
+        {
+            uint64_t token;
 
+            if(ended || !read_varint(token))
+            {
+                if(terminated && !ended)
+                {
+                    corrupt();                                                  // truncated: no end token
+                }
+                return false;
+            }
 
+            if((token & 1) == 0)                                                // literal
+            {
+                record.addr = uint32_t(token >> 2);
+                record.outcome = (token & 2) ? 't' : 'n';
 
-/*  argc holds the number of command line arguments
-    argv[] holds the commands themselves
+                window[window_pos++ & (BPZ_WINDOW - 1)] = record;
 
-    Example:-
-    sim bimodal 6 gcc_trace.txt
-    argc = 4
-    argv[0] = "sim"
-    argv[1] = "bimodal"
+                addr = record.addr;
+                outcome = record.outcome;
+
+                return true;
+            }
+
+            repeat_period = uint32_t(token >> 1) + 1;                            // repeat
+
+            if(!read_varint(repeat_count))
+            {
+                corrupt();
+            }
+
+            if(terminated && (token == 1) && (repeat_count == 0))               // end: the record count, then end of file
+            {
+                uint64_t record_count;
+                unsigned char byte;
+
+                if(!read_varint(record_count) || (record_count != window_pos) || read_byte(byte))
+                {
+                    corrupt();
+                }
+
+                ended = true;
+
+                return false;
+            }
+
+            if((repeat_count == 0) || (repeat_period > BPZ_WINDOW) || (repeat_period > window_pos))
+            {
+                corrupt();
+            }
+        }
+
+        record = window[(window_pos - repeat_period) & (BPZ_WINDOW - 1)];     // expand the repeat one record at a time
+        window[window_pos++ & (BPZ_WINDOW - 1)] = record;
+        repeat_count--;
+
+        addr = record.addr;
+        outcome = record.outcome;
+
+        return true;
+
+    }
+
+};
+
+
+// trace compressor: greedy LZ77-style encoding restricted to repeats of the recent trace,
+// i.e. each position is either a literal record or "repeat the last P records for L records",
+// choosing the period P <= BPZ_WINDOW that covers the longest run (candidate periods come from
+// the earlier occurrences of the current record, so non-repeating stretches stay cheap); the trace
+// is streamed through a ring of BPZ_RING records, so memory stays fixed whatever its length
+
+class trace_writer
+{
+
+private:
+
+    FILE *fp;
+    unsigned char *buffer;
+    size_t buffer_len;
+
+public:
+
+    size_t bytes_written;
+    bool failed;                                                                // a write came up short (e.g. disk full)
+
+    trace_writer(FILE *out)
+    {
+        fp = out;
+        buffer = new unsigned char[BPZ_BUFFER];
+        buffer_len = 0;
+        bytes_written = 0;
+        failed = false;
+    }
+
+    ~trace_writer()
+    {
+        delete[] buffer;
+    }
+
+    void write_bytes(const void *data, size_t len)
+    {
+
+        const unsigned char *bytes = (const unsigned char *) data;
+
+        for(size_t i = 0; i < len; i++)
+        {
+            if(buffer_len == BPZ_BUFFER)
+            {
+                flush();
+            }
+
+            buffer[buffer_len++] = bytes[i];
+        }
+
+        bytes_written += len;
+
+    }
+
+    void write_varint(uint64_t value)
+    {
+
+        unsigned char bytes[10];
+        size_t len = 0;
+
+        do
+        {
+            bytes[len] = value & 0x7f;
+            value >>= 7;
+
+            if(value != 0)
+            {
+                bytes[len] |= 0x80;
+            }
+
+            len++;
+
+        } while(value != 0);
+
+        write_bytes(bytes, len);
+
+    }
+
+    bool flush()                                                                // false once any block failed to write
+    {
+        if(fwrite(buffer, 1, buffer_len, fp) != buffer_len)
+        {
+            failed = true;
+        }
+
+        buffer_len = 0;
+
+        return !failed;
+    }
+
+};
+
+bool compress_trace(trace_reader &reader, FILE *out, size_t &record_count, size_t &compressed_size)     // false if the output could not be written
+{
+
+    trace_writer writer(out);
+
+    const uint64_t NO_PREVIOUS = UINT64_MAX;
+    const uint64_t RING_MASK = BPZ_RING - 1;
+    const uint64_t LOOKAHEAD = BPZ_RING - BPZ_WINDOW;                            // longest repeat emitted as one token
+
+    std::vector<branch_record> ring(BPZ_RING);                                   // records [i - BPZ_WINDOW, filled), by position & RING_MASK
+    std::vector<uint64_t> previous(BPZ_RING);                                    // previous position with the same record hash
+    std::vector<uint64_t> last_seen(size_t(1) << BPZ_HASH_BITS, NO_PREVIOUS);
+
+    branch_record record;
+    unsigned long addr;
+    uint64_t filled = 0;                                                         // records read from the trace so far
+    bool more = true;
+
+    writer.write_bytes(BPZ_MAGIC, BPZ_MAGIC_LEN);
+
+    uint64_t i = 0;
+
+    while(true)
+    {
+
+        while(more && (filled < i + LOOKAHEAD))                                  // top up the lookahead; only records older than the window are overwritten
+        {
+            more = reader.next(addr, record.outcome);
+
+            if(more)
+            {
+                record.addr = uint32_t(addr);
+
+                uint64_t key = (uint64_t(record.addr) << 8) | (unsigned char) record.outcome;
+                size_t hash = size_t((key * 0x9E3779B97F4A7C15ull) >> (64 - BPZ_HASH_BITS));
+
+                ring[filled & RING_MASK] = record;
+                previous[filled & RING_MASK] = last_seen[hash];
+                last_seen[hash] = filled;
+                filled++;
+            }
+        }
+
+        if(i == filled)
+        {
+            break;
+        }
+
+        size_t best_len = 0;
+        size_t best_period = 0;
+
+        for(uint64_t j = previous[i & RING_MASK]; (j != NO_PREVIOUS) && (i - j <= BPZ_WINDOW); j = previous[j & RING_MASK])      // only periods whose record hashes match
+        {
+
+            uint64_t p = i - j;
+            size_t len = 0;
+
+            while(i + len < filled)
+            {
+                const branch_record &current = ring[(i + len) & RING_MASK];
+                const branch_record &earlier = ring[(i + len - p) & RING_MASK];
+
+                if((current.addr != earlier.addr) || (current.outcome != earlier.outcome))
+                {
+                    break;
+                }
+
+                len++;
+            }
+
+            if(len > best_len)
+            {
+                best_len = len;
+                best_period = p;
+            }
+
+        }
+
+        if(best_len > 0)
+        {
+            writer.write_varint(((uint64_t(best_period) - 1) << 1) | 1);        // repeat token
+            writer.write_varint(best_len);
+            i += best_len;
+        }
+
+        else
+        {
+            const branch_record &current = ring[i & RING_MASK];
+
+            writer.write_varint((uint64_t(current.addr) << 2) | ((current.outcome == 't') ? 2 : 0));     // literal token
+            i++;
+        }
+
+    }
+
+    writer.write_varint(1);                                                     // end token
+    writer.write_varint(0);
+    writer.write_varint(filled);
+
+    record_count = filled;
+    compressed_size = writer.bytes_written;
+
+    return writer.flush();
+
+}
+
+long load_trace(const char *trace_file, std::vector<branch_record> &records)    // read a whole (text or compressed) trace into memory, returns its size in bytes
+{
+
+    trace_reader reader;
+    branch_record record;
+    unsigned long addr;
+
+    if(!reader.open(trace_file))
+    {
+        printf("Error: Unable to open file %s\n", trace_file);
+        exit(EXIT_FAILURE);
+    }
+
+    while(reader.next(addr, record.outcome))
+    {
+        record.addr = uint32_t(addr);
+        records.push_back(record);
+    }
+
+    long trace_size = reader.bytes_read();
+
+    reader.close();
+
+    return trace_size;
+
+}
+
+int compress_trace_file(const char *trace_file, const char *out_file)          // "sim compress": read a (text or compressed) trace and write it compressed
+{
+
+    trace_reader reader;
+
+    if(!reader.open(trace_file))
+    {
+        printf("Error: Unable to open file %s\n", trace_file);
+        exit(EXIT_FAILURE);
+    }
+
+    FILE *out = fopen(out_file, "wb");
+    if(out == NULL)
+    {
+        printf("Error: Unable to open file %s\n", out_file);
+        exit(EXIT_FAILURE);
+    }
+
+    size_t record_count;
+    size_t compressed_size;
+    bool written = compress_trace(reader, out, record_count, compressed_size);
+    long trace_size = reader.bytes_read();
+
+    if((fclose(out) != 0) || !written)                                          // fclose() flushes the last stdio block
+    {
+        printf("Error: Unable to write file %s\n", out_file);
+        exit(EXIT_FAILURE);
+    }
+
+    printf("OUTPUT\n");
+    printf(" number of records:        %zu\n", record_count);
+    printf(" trace size:               %ld bytes\n", trace_size);
+    printf(" compressed size:          %zu bytes\n", compressed_size);
+    printf(" compression ratio:        %0.2f\n", double(trace_size)/double(compressed_size));
+
+    return 0;
+
+}
+
+
+// calls next.call<C>() with the counter kind C (see counter_table) as a compile-time constant: the
+// runtime width, plus COUNTER_STEPPED for steps other than 1, when ENABLED, else unit-step
+// COUNTER_BITS for a table the predictor does not have
+
+template<bool ENABLED>
+struct width_dispatch
+{
+    template<typename Next>
+    static void apply(const counter_params &counters, Next &next)
+    {
+        bool stepped = (counters.inc != 1) || (counters.dec != 1);
+
+        switch(counters.width | (stepped ? COUNTER_STEPPED : 0))
+        {
+            case 1: next.template call<1>(); break;
+            case 2: next.template call<2>(); break;
+            case 3: next.template call<3>(); break;
+            case 4: next.template call<4>(); break;
+            case 1 | COUNTER_STEPPED: next.template call<1 | COUNTER_STEPPED>(); break;
+            case 2 | COUNTER_STEPPED: next.template call<2 | COUNTER_STEPPED>(); break;
+            case 3 | COUNTER_STEPPED: next.template call<3 | COUNTER_STEPPED>(); break;
+            case 4 | COUNTER_STEPPED: next.template call<4 | COUNTER_STEPPED>(); break;
+        }
+    }
+};
+
+template<>
+struct width_dispatch<false>
+{
+    template<typename Next>
+    static void apply(const counter_params &counters, Next &next)
+    {
+        next.template call<COUNTER_BITS>();
+    }
+};
+
+
+// branch simulator: one configured predictor (bimodal, gshare or hybrid) driven a branch at a time;
+// the tables are allocated once and reset in bulk, so one instance can run many traces
+
+class branch_simulator
+{
+
+public:
+
+    bp_params params;
+    predictor_kind kind;
+
+    bimodal_branch_predictor *bimodal = nullptr;                    // bimodal pointer pointing to the "bimodal_branch_predictor" class
+    gshare_branch_predictor *gshare = nullptr;                      // ghare pointer pointing to the "gshare_branch_predcitor" class
+    hybrid_branch_predictor *hybrid = nullptr;                      // hybrid pointer pointing to the "hybrid_branch_predcitor" class
+
+    pending_update *pending;                                        // ring buffer of the updates not yet committed
+    uint64_t pending_mask;
+    uint64_t pending_head = 0;                                      // oldest update in flight
+    uint64_t pending_tail = 0;                                      // next free entry
+
+    branch_simulator(const bp_params &config, predictor_kind predictor)
+    {
+
+        params = config;
+        kind = predictor;
+
+        size_t pending_size = 1;                                    // power of 2 holding params.D + 1 updates
+
+        while(pending_size <= params.D)
+        {
+            pending_size <<= 1;
+        }
+
+        pending = new pending_update[pending_size];
+        pending_mask = pending_size - 1;
+
+        if(kind == PREDICTOR_BIMODAL)                               // bimodal
+        {
+            bimodal = new bimodal_branch_predictor(params.M2, params.bimodal_counter);       // call the constructor to initialize the branch history table
+        }
+
+        if(kind == PREDICTOR_GSHARE)                                // gshare
+        {
+            gshare = new gshare_branch_predictor(params.M1, params.gshare_counter);          // call the constructor to initialize the branch history table
+        }
+
+        if(kind == PREDICTOR_HYBRID)                                // hybrid
+        {
+            bimodal = new bimodal_branch_predictor(params.M2, params.bimodal_counter);       // call the constructor to initialize the branch history table
+            gshare = new gshare_branch_predictor(params.M1, params.gshare_counter);          // call the constructor to initialize the branch history table
+            hybrid = new hybrid_branch_predictor(params.K, params.chooser_counter);          // call the constructor to initialize the chooser table
+        }
+
+    }
+
+    ~branch_simulator()
+    {
+        delete[] pending;
+        delete bimodal;
+        delete gshare;
+        delete hybrid;
+    }
+
+    void reset()                                                    // reset all tables and statistics for the next trace
+    {
+        if(bimodal != nullptr) bimodal -> reset();
+        if(gshare != nullptr) gshare -> reset();
+        if(hybrid != nullptr) hybrid -> reset();
+
+        pending_head = 0;
+        pending_tail = 0;
+    }
+
+    // hot path, specialized per predictor and per counter kind of each table (WB bimodal, WG gshare,
+    // WC chooser) so that the per-branch work is straight-line code:
+    // predict_branch() predicts with the speculative history and queues the table updates,
+    // commit_branch() applies the oldest queued update once it is params.D branches old.
+    // The trace only holds the correct path, so a mispredicted branch has resolved and repaired
+    // the history before the next branch is fetched, while its table updates still wait to commit.
+
+    template<predictor_kind KIND, unsigned WB, unsigned WG, unsigned WC>
+    HOT_PATH void predict_branch(uint32_t addr, uint32_t taken)
+    {
+
+        pending_update &entry = pending[pending_tail++ & pending_mask];
+        uint32_t prediction;
+
+        entry.taken = taken;
+
+        if(KIND != PREDICTOR_GSHARE)
+        {
+            entry.bimodal_index = bimodal -> index_bimodal(addr, params.M2);            // M2 lower pc bits
+            entry.bimodal_taken = bimodal -> predict<WB>(entry.bimodal_index);
+
+            bimodal -> m_stats.m_predictions_bimodal++;
+            bimodal -> m_stats.m_mispredictions_bimodal += entry.bimodal_taken ^ taken;
+        }
+
+        if(KIND != PREDICTOR_BIMODAL)
+        {
+            entry.gshare_index = gshare -> index_gshare(addr, params.M1, params.N);     // M1 lower pc bits xor N history bits
+            entry.gshare_taken = gshare -> predict<WG>(entry.gshare_index);
+
+            gshare -> m_stats.m_predictions_gshare++;
+            gshare -> m_stats.m_mispredictions_gshare += entry.gshare_taken ^ taken;
+        }
+
+        if(KIND == PREDICTOR_BIMODAL)
+        {
+            prediction = entry.bimodal_taken;
+        }
+
+        if(KIND == PREDICTOR_GSHARE)
+        {
+            prediction = entry.gshare_taken;
+        }
+
+        if(KIND == PREDICTOR_HYBRID)
+        {
+            entry.chooser_index = hybrid -> index_hybrid(addr, params.K);               // K lower pc bits
+            entry.sel_gshare = hybrid -> select_predictor<WC>(entry.chooser_index);
+
+            prediction = (entry.sel_gshare & entry.gshare_taken) | ((entry.sel_gshare ^ 1) & entry.bimodal_taken);
+
+            hybrid -> m_stats.m_predictions_hybrid++;
+            hybrid -> m_stats.m_mispredictions_hybrid += prediction ^ taken;
+        }
+
+        if(KIND != PREDICTOR_BIMODAL)
+        {
+            gshare -> update_global_history(params.N, prediction);                    // speculative
+            gshare -> repair_global_history(params.N, taken);                          // no-op unless mispredicted
+        }
+
+        if(pending_tail - pending_head > params.D)
+        {
+            commit_branch<KIND, WB, WG, WC>();
+        }
+
+    }
+
+    template<predictor_kind KIND, unsigned WB, unsigned WG, unsigned WC>
+    HOT_PATH void commit_branch()
+    {
+
+        pending_update &entry = pending[pending_head++ & pending_mask];
+
+        if(KIND == PREDICTOR_BIMODAL)
+        {
+            bimodal -> update_branch_table<WB>(entry.bimodal_index, entry.taken, 1);
+        }
+
+        if(KIND == PREDICTOR_GSHARE)
+        {
+            gshare -> update_branch_table<WG>(entry.gshare_index, entry.taken, 1);
+        }
+
+        if(KIND == PREDICTOR_HYBRID)                                                   // only the selected predictor is updated
+        {
+            gshare -> update_branch_table<WG>(entry.gshare_index, entry.taken, entry.sel_gshare);
+            bimodal -> update_branch_table<WB>(entry.bimodal_index, entry.taken, entry.sel_gshare ^ 1);
+            hybrid -> update_chooser_table<WC>(entry.chooser_index, (entry.gshare_taken ^ entry.taken) ^ 1, (entry.bimodal_taken ^ entry.taken) ^ 1);
+        }
+
+    }
+
+    // a kernel_job runs on the instantiation matching params (see dispatch())
+
+    enum kernel_job { JOB_RUN_TRACE, JOB_SIMULATE, JOB_FINISH };
+
+    trace_reader *job_reader;                                       // JOB_RUN_TRACE
+    const branch_record *job_records;                               // JOB_SIMULATE
+    size_t job_count;
+
+    template<predictor_kind KIND, unsigned WB, unsigned WG, unsigned WC>
+    void run_trace_kernel()                                         // every branch of an opened trace
+    {
+
+        unsigned long addr;
+        char outcome;
+
+        while(job_reader -> next(addr, outcome))
+        {
+            predict_branch<KIND, WB, WG, WC>(addr, outcome == 't');
+        }
+
+    }
+
+    template<predictor_kind KIND, unsigned WB, unsigned WG, unsigned WC>
+    void simulate_kernel()                                          // a batch of records, leaving the last updates in flight
+    {
+
+        for(size_t i = 0; i < job_count; i++)
+        {
+            predict_branch<KIND, WB, WG, WC>(job_records[i].addr, job_records[i].outcome == 't');
+        }
+
+    }
+
+    template<predictor_kind KIND, unsigned WB, unsigned WG, unsigned WC>
+    void finish_kernel()                                            // commit the updates still in flight
+    {
+
+        while(pending_head != pending_tail)
+        {
+            commit_branch<KIND, WB, WG, WC>();
+        }
+
+    }
+
+    template<predictor_kind KIND, unsigned WB, unsigned WG, unsigned WC>
+    void run_job(kernel_job job)
+    {
+
+        if(job == JOB_RUN_TRACE)
+        {
+            run_trace_kernel<KIND, WB, WG, WC>();
+        }
+
+        if(job == JOB_SIMULATE)
+        {
+            simulate_kernel<KIND, WB, WG, WC>();
+        }
+
+        if((job == JOB_RUN_TRACE) || (job == JOB_FINISH))
+        {
+            finish_kernel<KIND, WB, WG, WC>();
+        }
+
+    }
+
+    // dispatch() resolves the counter kinds one table at a time (chooser, gshare, bimodal); a table
+    // the predictor does not have is fixed at COUNTER_BITS so that only the used combinations exist
+
+    template<predictor_kind KIND, unsigned WC, unsigned WG>
+    struct bimodal_width
+    {
+        branch_simulator *simulator;
+        kernel_job job;
+
+        template<unsigned WB>
+        void call()
+        {
+            simulator -> run_job<KIND, WB, WG, WC>(job);
+        }
+    };
+
+    template<predictor_kind KIND, unsigned WC>
+    struct gshare_width
+    {
+        branch_simulator *simulator;
+        kernel_job job;
+
+        template<unsigned WG>
+        void call()
+        {
+            bimodal_width<KIND, WC, WG> next = { simulator, job };
+            width_dispatch<KIND != PREDICTOR_GSHARE>::apply(simulator -> params.bimodal_counter, next);
+        }
+    };
+
+    template<predictor_kind KIND>
+    struct chooser_width
+    {
+        branch_simulator *simulator;
+        kernel_job job;
+
+        template<unsigned WC>
+        void call()
+        {
+            gshare_width<KIND, WC> next = { simulator, job };
+            width_dispatch<KIND != PREDICTOR_BIMODAL>::apply(simulator -> params.gshare_counter, next);
+        }
+    };
+
+    void dispatch(kernel_job job)
+    {
+
+        if(kind == PREDICTOR_BIMODAL)
+        {
+            chooser_width<PREDICTOR_BIMODAL> next = { this, job };
+            width_dispatch<false>::apply(params.chooser_counter, next);
+        }
+
+        if(kind == PREDICTOR_GSHARE)
+        {
+            chooser_width<PREDICTOR_GSHARE> next = { this, job };
+            width_dispatch<false>::apply(params.chooser_counter, next);
+        }
+
+        if(kind == PREDICTOR_HYBRID)
+        {
+            chooser_width<PREDICTOR_HYBRID> next = { this, job };
+            width_dispatch<true>::apply(params.chooser_counter, next);
+        }
+
+    }
+
+    void simulate(const branch_record *records, size_t n)          // predict a batch of branches, leaving the last updates in flight
+    {
+        job_records = records;
+        job_count = n;
+        dispatch(JOB_SIMULATE);
+    }
+
+    void finish()                                                   // commit the updates still in flight at the end of a trace
+    {
+        dispatch(JOB_FINISH);
+    }
+
+    void run(trace_reader &reader)                                  // simulate every branch of an opened trace
+    {
+        job_reader = &reader;
+        dispatch(JOB_RUN_TRACE);
+    }
+
+    void run(const branch_record *records, size_t n)               // simulate a trace already loaded in memory
+    {
+        simulate(records, n);
+        finish();
+    }
+
+    size_t predictions()
+    {
+        if(kind == PREDICTOR_BIMODAL) return bimodal -> m_stats.m_predictions_bimodal;
+        if(kind == PREDICTOR_GSHARE) return gshare -> m_stats.m_predictions_gshare;
+        return hybrid -> m_stats.m_predictions_hybrid;
+    }
+
+    size_t mispredictions()
+    {
+        if(kind == PREDICTOR_BIMODAL) return bimodal -> m_stats.m_mispredictions_bimodal;
+        if(kind == PREDICTOR_GSHARE) return gshare -> m_stats.m_mispredictions_gshare;
+        return hybrid -> m_stats.m_mispredictions_hybrid;
+    }
+
+    static size_t storage_bits(const bp_params &config, predictor_kind predictor)     // modeled hardware storage of a configuration
+    {
+
+        size_t bits = 0;
+
+        if(predictor != PREDICTOR_GSHARE) bits += bimodal_branch_predictor::storage_bits(config.M2, config.bimodal_counter.width);
+        if(predictor != PREDICTOR_BIMODAL) bits += gshare_branch_predictor::storage_bits(config.M1, config.N, config.gshare_counter.width);
+        if(predictor == PREDICTOR_HYBRID) bits += hybrid_branch_predictor::storage_bits(config.K, config.chooser_counter.width);
+
+        return bits;
+
+    }
+
+    size_t storage_bits()
+    {
+        return storage_bits(params, kind);
+    }
+
+    size_t resident_bytes()                                         // simulator memory actually allocated for the predictor
+    {
+
+        size_t bytes = sizeof(*this);
+
+        if(bimodal != nullptr) bytes += bimodal -> resident_bytes();
+        if(gshare != nullptr) bytes += gshare -> resident_bytes();
+        if(hybrid != nullptr) bytes += hybrid -> resident_bytes();
+
+        bytes += (pending_mask + 1) * sizeof(pending_update);
+
+        return bytes;
+
+    }
+
+    void print_storage()                                            // "--storage": hardware budget and simulator footprint
+    {
+
+        printf("STORAGE\n");
+        printf(" hardware storage:         %zu bits (%0.2f KB)\n", storage_bits(), double(storage_bits())/8192);
+        printf(" simulator memory:         %zu bytes\n", resident_bytes());
+
+    }
+
+    void print_output()                                             // final statistics and table contents
+    {
+
+        printf("OUTPUT\n");
+        printf(" number of predictions:    %zu\n", predictions());
+        printf(" number of mispredictions: %zu\n", mispredictions());
+        printf(" misprediction rate:       %0.2f%%\n", (double(mispredictions())/double(predictions())*100));
+
+        if(kind == PREDICTOR_BIMODAL)
+        {
+            bimodal -> print_bimodal_contents(params.M2);
+        }
+
+        if(kind == PREDICTOR_GSHARE)
+        {
+            gshare -> print_gshare_contents(params.M1);
+        }
+
+        if(kind == PREDICTOR_HYBRID)
+        {
+            hybrid -> print_hybrid_contents(params.K);
+            gshare -> print_gshare_contents(params.M1);
+            bimodal -> print_bimodal_contents(params.M2);
+        }
+
+    }
+
+};
+
+
+bool parse_predictor(const char *name, predictor_kind &kind, int &param_count)     // predictor name -> kind and number of numeric parameters
+{
+
+    if(strcmp(name, "bimodal") == 0)
+    {
+        kind = PREDICTOR_BIMODAL;
+        param_count = 1;                                            // M2
+    }
+    else if(strcmp(name, "gshare") == 0)
+    {
+        kind = PREDICTOR_GSHARE;
+        param_count = 2;                                            // M1 N
+    }
+    else if(strcmp(name, "hybrid") == 0)
+    {
+        kind = PREDICTOR_HYBRID;
+        param_count = 4;                                            // K M1 N M2
+    }
+    else
+    {
+        return false;
+    }
+
+    return true;
+
+}
+
+void read_predictor_params(bp_params &params, predictor_kind kind, char *args[])     // numeric parameters in command line order
+{
+
+    if(kind == PREDICTOR_BIMODAL)
+    {
+        params.M2       = strtoul(args[0], NULL, 10);
+    }
+
+    if(kind == PREDICTOR_GSHARE)
+    {
+        params.M1       = strtoul(args[0], NULL, 10);
+        params.N        = strtoul(args[1], NULL, 10);
+    }
+
+    if(kind == PREDICTOR_HYBRID)
+    {
+        params.K        = strtoul(args[0], NULL, 10);
+        params.M1       = strtoul(args[1], NULL, 10);
+        params.N        = strtoul(args[2], NULL, 10);
+        params.M2       = strtoul(args[3], NULL, 10);
+    }
+
+}
+
+
+// runs worker() on as many threads as there are cores (at most job_count); the workers pull
+// their job indices from a shared atomic counter
+
+template<typename Worker>
+void run_thread_pool(size_t job_count, Worker worker)
+{
+
+    size_t thread_count = std::thread::hardware_concurrency();
+
+    if(thread_count == 0)
+    {
+        thread_count = 1;
+    }
+
+    if(thread_count > job_count)
+    {
+        thread_count = job_count;
+    }
+
+    std::vector<std::thread> threads;
+
+    for(size_t i = 0; i < thread_count; i++)
+    {
+        threads.push_back(std::thread(worker));
+    }
+
+    for(size_t i = 0; i < thread_count; i++)
+    {
+        threads[i].join();
+    }
+
+}
+
+
+void print_command(int argc, char* argv[])                          // echo the full command line, as the single runs do
+{
+
+    printf("COMMAND\n%s", argv[0]);
+    for(int i = 1; i < argc; i++)
+    {
+        printf(" %s", argv[i]);
+    }
+    printf("\n");
+
+}
+
+
+// batch runner ("sim batch <bimodal|gshare|hybrid> <params...> <trace_file|glob>..."): runs one
+// configuration over many traces on a pool of threads, each thread reusing a single simulator
+
+typedef struct batch_result{
+    std::string       trace_file;
+    bool              opened;
+    size_t            predictions;
+    size_t            mispredictions;
+}batch_result;
+
+void run_batch_worker(const bp_params *params, predictor_kind kind, std::vector<batch_result> *results, std::atomic<size_t> *next_trace)
+{
+
+    branch_simulator simulator(*params, kind);                      // allocated once per thread, reset for every trace
+    trace_reader reader;
+
+    for(size_t i = (*next_trace)++; i < results -> size(); i = (*next_trace)++)
+    {
+
+        batch_result &result = (*results)[i];
+
+        result.opened = reader.open(result.trace_file.c_str());
+
+        if(!result.opened)
+        {
+            continue;
+        }
+
+        simulator.reset();
+        simulator.run(reader);
+        reader.close();
+
+        result.predictions = simulator.predictions();
+        result.mispredictions = simulator.mispredictions();
+
+    }
+
+}
+
+int run_batch(int argc, char* argv[], const bp_params &options, bool print_storage)
+{
+
+    bp_params params = options;
+    predictor_kind kind;
+    int param_count;
+
+    if((argc < 3) || !parse_predictor(argv[2], kind, param_count))
+    {
+        printf("Error: Wrong branch predictor name:%s\n", (argc < 3) ? "" : argv[2]);
+        exit(EXIT_FAILURE);
+    }
+
+    if(argc < 4 + param_count)
+    {
+        printf("Error: %s wrong number of inputs:%d\n", argv[1], argc-1);
+        exit(EXIT_FAILURE);
+    }
+
+    params.bp_name = argv[2];
+    read_predictor_params(params, kind, &argv[3]);
+
+    print_command(argc, argv);
+
+    std::vector<batch_result> results;                              // expand the trace arguments (quoted globs included)
+
+    for(int i = 3 + param_count; i < argc; i++)
+    {
+
+        glob_t matches;
+
+        glob(argv[i], GLOB_NOCHECK, NULL, &matches);
+
+        for(size_t j = 0; j < matches.gl_pathc; j++)
+        {
+            batch_result result = { matches.gl_pathv[j], false, 0, 0 };
+            results.push_back(result);
+        }
+
+        globfree(&matches);
+
+    }
+
+    std::atomic<size_t> next_trace(0);
+
+    run_thread_pool(results.size(), [&]() { run_batch_worker(&params, kind, &results, &next_trace); });
+
+    int status = 0;
+    double log_sum = 0;
+    size_t traces = 0;
+    bool zero_rate = false;
+
+    printf("OUTPUT\n");
+    printf(" %-40s %12s %15s %19s\n", "trace", "predictions", "mispredictions", "misprediction rate");
+
+    for(size_t i = 0; i < results.size(); i++)
+    {
+
+        if(!results[i].opened)
+        {
+            printf("Error: Unable to open file %s\n", results[i].trace_file.c_str());
+            status = EXIT_FAILURE;
+            continue;
+        }
+
+        if(results[i].predictions == 0)                             // empty, or not a trace at all: no rate, kept out of the mean
+        {
+            printf("Error: No branches in trace file %s\n", results[i].trace_file.c_str());
+            status = EXIT_FAILURE;
+            continue;
+        }
+
+        double rate = double(results[i].mispredictions)/double(results[i].predictions)*100;
+
+        printf(" %-40s %12zu %15zu %18.2f%%\n", results[i].trace_file.c_str(), results[i].predictions, results[i].mispredictions, rate);
+
+        if(rate > 0)
+        {
+            log_sum += log(rate);
+        }
+        else
+        {
+            zero_rate = true;                                       // a perfectly predicted trace makes the geometric mean 0
+        }
+
+        traces++;
+
+    }
+
+    if(traces > 0)
+    {
+        printf(" geometric mean misprediction rate: %0.2f%%\n", zero_rate ? 0.0 : exp(log_sum / traces));
+    }
+
+    if(print_storage)                                               // the same configuration for every trace: report it once
+    {
+        branch_simulator simulator(params, kind);
+
+        simulator.print_storage();
+    }
+
+    return status;
+
+}
+
+
+// design-space sweep ("sim sweep <bimodal|gshare|hybrid> <budget_kb> [<min_kb>] <trace_file>"): evaluates
+// every configuration whose modeled storage fits in the budget (and is at least min_kb, to skip the
+// small configurations of large hybrid sweeps), on a trace loaded once into memory, and ranks them by
+// misprediction rate. Misprediction rate per KB is printed as a column but not used as the ranking key:
+// the rate falls far slower than storage grows, so rate/KB always puts the largest configuration first
+// whatever its accuracy.
+
+#define SWEEP_MAX_INDEX_BITS    30          // the index functions build their masks with int shifts
+#define SWEEP_MAX_KB            (1ul << 32) // keeps budget_kb * 8192 well inside size_t
+
+double parse_storage_kb(const char *value, const char *what)        // a non-negative number of KB, else an error
+{
+
+    char *end = NULL;
+    double kb = strtod(value, &end);
+
+    if((((*value < '0') || (*value > '9')) && (*value != '.')) || (*end != '\0') || !(kb <= SWEEP_MAX_KB))     // also rejects "-1", "nan" and "inf"
+    {
+        printf("Error: Wrong storage %s:%s (0 to %lu KB)\n", what, value, SWEEP_MAX_KB);
+        exit(EXIT_FAILURE);
+    }
+
+    return kb;
+
+}
+
+typedef struct sweep_result{
+    bp_params         params;
+    size_t            storage_bits;
+    size_t            predictions;
+    size_t            mispredictions;
+}sweep_result;
+
+void add_sweep_config(std::vector<sweep_result> &configs, const bp_params &params, predictor_kind kind, size_t min_bits, size_t budget_bits)
+{
+
+    sweep_result config = { params, branch_simulator::storage_bits(params, kind), 0, 0 };
+
+    if((config.storage_bits >= min_bits) && (config.storage_bits <= budget_bits))
+    {
+        configs.push_back(config);
+    }
+
+}
+
+void sweep_configurations(std::vector<sweep_result> &configs, const bp_params &options, predictor_kind kind, size_t min_bits, size_t budget_bits)     // every configuration within the budget
+{
+
+    bp_params params = options;
+
+    if(kind == PREDICTOR_BIMODAL)
+    {
+        for(params.M2 = 1; params.M2 <= SWEEP_MAX_INDEX_BITS; params.M2++)
+        {
+            add_sweep_config(configs, params, kind, min_bits, budget_bits);
+        }
+    }
+
+    if(kind == PREDICTOR_GSHARE)
+    {
+        for(params.M1 = 1; params.M1 <= SWEEP_MAX_INDEX_BITS; params.M1++)
+        {
+            for(params.N = 1; params.N <= params.M1; params.N++)
+            {
+                add_sweep_config(configs, params, kind, min_bits, budget_bits);
+            }
+        }
+    }
+
+    if(kind == PREDICTOR_HYBRID)
+    {
+        for(params.K = 1; params.K <= SWEEP_MAX_INDEX_BITS; params.K++)
+        {
+            for(params.M1 = 1; params.M1 <= SWEEP_MAX_INDEX_BITS; params.M1++)
+            {
+                for(params.N = 1; params.N <= params.M1; params.N++)
+                {
+                    for(params.M2 = 1; params.M2 <= SWEEP_MAX_INDEX_BITS; params.M2++)
+                    {
+                        add_sweep_config(configs, params, kind, min_bits, budget_bits);
+                    }
+                }
+            }
+        }
+    }
+
+}
+
+void format_config(char *buffer, size_t len, const char *name, const bp_params &params, predictor_kind kind)     // "<name> <params...>" as on the command line
+{
+
+    if(kind == PREDICTOR_BIMODAL) snprintf(buffer, len, "%s %lu", name, params.M2);
+    if(kind == PREDICTOR_GSHARE) snprintf(buffer, len, "%s %lu %lu", name, params.M1, params.N);
+    if(kind == PREDICTOR_HYBRID) snprintf(buffer, len, "%s %lu %lu %lu %lu", name, params.K, params.M1, params.N, params.M2);
+
+}
+
+int run_sweep(int argc, char* argv[], const bp_params &options)
+{
+
+    predictor_kind kind;
+    int param_count;
+
+    if(!(argc == 5 || argc == 6))
+    {
+        printf("Error: %s wrong number of inputs:%d\n", argv[1], argc-1);
+        exit(EXIT_FAILURE);
+    }
+
+    if(!parse_predictor(argv[2], kind, param_count))
+    {
+        printf("Error: Wrong branch predictor name:%s\n", argv[2]);
+        exit(EXIT_FAILURE);
+    }
+
+    double budget_kb = parse_storage_kb(argv[3], "budget");
+    double min_kb = (argc == 6) ? parse_storage_kb(argv[4], "floor") : 0;
+
+    if(min_kb > budget_kb)
+    {
+        printf("Error: Storage floor %s above budget %s\n", argv[4], argv[3]);
+        exit(EXIT_FAILURE);
+    }
+    size_t budget_bits = size_t(budget_kb * 8192);
+    size_t min_bits = size_t(min_kb * 8192);
+    char *trace_file = argv[argc - 1];
+
+    print_command(argc, argv);
+
+    std::vector<branch_record> records;                             // load the trace once, shared read-only by all threads
+
+    load_trace(trace_file, records);
+
+    std::vector<sweep_result> configs;
+
+    sweep_configurations(configs, options, kind, min_bits, budget_bits);
+
+    std::atomic<size_t> next_config(0);
+
+    run_thread_pool(configs.size(), [&]()
+    {
+        for(size_t i = next_config++; i < configs.size(); i = next_config++)
+        {
+            branch_simulator simulator(configs[i].params, kind);
+
+            simulator.run(records.data(), records.size());
+
+            configs[i].predictions = simulator.predictions();
+            configs[i].mispredictions = simulator.mispredictions();
+        }
+    });
+
+    std::sort(configs.begin(), configs.end(), [](const sweep_result &a, const sweep_result &b)
+    {
+        double a_rate = (a.predictions == 0) ? 0 : double(a.mispredictions)/double(a.predictions);
+        double b_rate = (b.predictions == 0) ? 0 : double(b.mispredictions)/double(b.predictions);
+
+        return (a_rate != b_rate) ? (a_rate < b_rate) : (a.storage_bits < b.storage_bits);
+    });
+
+    printf("OUTPUT\n");
+    printf(" storage budget:           %0.2f KB (%zu bits)\n", budget_kb, budget_bits);
+    printf(" storage floor:            %0.2f KB (%zu bits)\n", min_kb, min_bits);
+    printf(" configurations evaluated: %zu\n", configs.size());
+    printf(" %5s  %-28s %14s %12s %19s %12s\n", "rank", "configuration", "storage (bits)", "storage (KB)", "misprediction rate", "rate per KB");
+
+    for(size_t i = 0; i < configs.size(); i++)
+    {
+
+        char config[64];
+        double kb = double(configs[i].storage_bits)/8192;
+        double rate = (configs[i].predictions == 0) ? 0 : double(configs[i].mispredictions)/double(configs[i].predictions)*100;
+
+        format_config(config, sizeof(config), argv[2], configs[i].params, kind);
+
+        printf(" %5zu  %-28s %14zu %12.2f %18.2f%% %11.4f%%\n", i + 1, config, configs[i].storage_bits, kb, rate, rate/kb);
+
+    }
+
+    return 0;
+
+}
+
+
+// simulation server ("sim serve <bimodal|gshare|hybrid> <params...> [<socket_path>]"): keeps one
+// simulator resident and reads bp_message streams (see sim_bp.h) from stdin, replying on stdout, or
+// from the clients of a Unix domain socket, one connection at a time. Branch records are read
+// straight into an aligned buffer and simulated in place. In stdin mode stdout carries only the
+// reply frames; diagnostics and the final report go to stderr.
+
+class branch_server
+{
+
+private:
+
+    branch_simulator *simulator;
+    branch_record *buffer;                                          // BP_SERVER_BUFFER bytes, records are simulated from here
+
+public:
+
+    bool shutdown;
+
+    branch_server(branch_simulator *resident)
+    {
+        simulator = resident;
+        buffer = new branch_record[BP_SERVER_BUFFER / sizeof(branch_record)];
+        shutdown = false;
+    }
+
+    ~branch_server()
+    {
+        delete[] buffer;
+    }
+
+    bool reply(int fd, const void *data, size_t len)
+    {
+
+        const char *bytes = (const char *) data;
+
+        while(len > 0)
+        {
+            ssize_t written = send(fd, bytes, len, MSG_NOSIGNAL);
+
+            if((written < 0) && (errno == ENOTSOCK))                // stdout is not a socket
+            {
+                written = write(fd, bytes, len);
+            }
+
+            if(written < 0)
+            {
+                if(errno == EINTR)
+                {
+                    continue;
+                }
+                return false;
+            }
+
+            bytes += written;
+            len -= written;
+        }
+
+        return true;
+
+    }
+
+    void serve(int in_fd, int out_fd)                               // handle messages until the input ends or a shutdown
+    {
+
+        char *bytes = (char *) buffer;
+        size_t len = 0;                                             // bytes in the buffer
+        size_t pos = 0;                                             // first byte not yet consumed
+        uint64_t records_left = 0;                                  // records still expected by the current BP_MSG_BRANCHES
+
+        while(!shutdown)
+        {
+
+            if(records_left > 0)
+            {
+                size_t available = (len - pos) / sizeof(branch_record);
+                size_t n = (records_left < available) ? records_left : available;
+
+                if(n > 0)
+                {
+                    simulator -> simulate((const branch_record *) (bytes + pos), n);
+                    pos += n * sizeof(branch_record);
+                    records_left -= n;
+                    continue;
+                }
+            }
+
+            else if(len - pos >= sizeof(bp_message))
+            {
+                bp_message message;
+
+                memcpy(&message, bytes + pos, sizeof(message));
+                pos += sizeof(message);
+
+                if(message.type == BP_MSG_BRANCHES)
+                {
+                    records_left = message.count;
+                }
+
+                else if(message.type == BP_MSG_STATS)
+                {
+                    bp_stats_reply stats = { simulator -> predictions(), simulator -> mispredictions() };
+
+                    if(!reply(out_fd, &stats, sizeof(stats)))
+                    {
+                        return;                                     // client went away
+                    }
+                }
+
+                else if(message.type == BP_MSG_RESET)
+                {
+                    simulator -> reset();
+                }
+
+                else if(message.type == BP_MSG_SHUTDOWN)
+                {
+                    shutdown = true;
+                }
+
+                else
+                {
+                    printf("Error: Wrong server message type:%u\n", message.type);
+                    return;
+                }
+
+                continue;
+            }
+
+            if(pos > 0)                                             // keep the partial message or record at the front
+            {
+                memmove(bytes, bytes + pos, len - pos);
+                len -= pos;
+                pos = 0;
+            }
+
+            ssize_t received = read(in_fd, bytes + len, BP_SERVER_BUFFER - len);
+
+            if(received < 0 && errno == EINTR)
+            {
+                continue;
+            }
+
+            if(received <= 0)                                       // end of input
+            {
+                if(records_left > 0)                                // a tracer must not lose branches unnoticed
+                {
+                    printf("Error: Input ended inside a branch message, %" PRIu64 " branch records lost\n", records_left);
+                }
+                else if(len > 0)
+                {
+                    printf("Error: Input ended inside a message header\n");
+                }
+                return;
+            }
+
+            len += received;
+
+        }
+
+    }
+
+};
+
+int run_server(int argc, char* argv[], const bp_params &options, bool print_storage)
+{
+
+    bp_params params = options;
+    predictor_kind kind;
+    int param_count;
+
+    signal(SIGPIPE, SIG_IGN);                                       // a client going away fails write() instead of killing the server
+
+    if((argc < 3) || !parse_predictor(argv[2], kind, param_count))
+    {
+        printf("Error: Wrong branch predictor name:%s\n", (argc < 3) ? "" : argv[2]);
+        exit(EXIT_FAILURE);
+    }
+
+    if(!(argc == 3 + param_count || argc == 4 + param_count))
+    {
+        printf("Error: %s wrong number of inputs:%d\n", argv[1], argc-1);
+        exit(EXIT_FAILURE);
+    }
+
+    params.bp_name = argv[2];
+    read_predictor_params(params, kind, &argv[3]);
+
+    branch_simulator simulator(params, kind);
+    branch_server server(&simulator);
+
+    if(argc == 3 + param_count)                                     // stdin / stdout
+    {
+        int reply_fd = dup(STDOUT_FILENO);
+
+        fflush(stdout);
+        dup2(STDERR_FILENO, STDOUT_FILENO);                         // printf() output goes to stderr from here on
+
+        server.serve(STDIN_FILENO, reply_fd);
+        close(reply_fd);
+    }
+
+    else
+    {
+        const char *socket_path = argv[argc - 1];
+        struct sockaddr_un address;
+
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+
+        if(strlen(socket_path) >= sizeof(address.sun_path))
+        {
+            printf("Error: Socket path too long:%s\n", socket_path);
+            exit(EXIT_FAILURE);
+        }
+
+        strcpy(address.sun_path, socket_path);
+
+        int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        struct stat existing;
+
+        if(listen_fd < 0)
+        {
+            printf("Error: Unable to listen on socket %s\n", socket_path);
+            exit(EXIT_FAILURE);
+        }
+
+        if(lstat(socket_path, &existing) == 0)
+        {
+            if(!S_ISSOCK(existing.st_mode))                         // never replace a file that is not a socket
+            {
+                printf("Error: Unable to listen on socket %s\n", socket_path);
+                exit(EXIT_FAILURE);
+            }
+
+            unlink(socket_path);                                    // stale socket of a previous server
+        }
+
+        if((bind(listen_fd, (struct sockaddr *) &address, sizeof(address)) != 0) || (listen(listen_fd, 1) != 0))
+        {
+            printf("Error: Unable to listen on socket %s\n", socket_path);
+            exit(EXIT_FAILURE);
+        }
+
+        while(!server.shutdown)
+        {
+            int client_fd = accept(listen_fd, NULL, NULL);
+
+            if(client_fd < 0)
+            {
+                if(errno == EINTR)
+                {
+                    continue;
+                }
+                printf("Error: Unable to accept on socket %s\n", socket_path);
+                exit(EXIT_FAILURE);
+            }
+
+            server.serve(client_fd, client_fd);
+            close(client_fd);
+        }
+
+        close(listen_fd);
+        unlink(socket_path);
+    }
+
+    simulator.finish();                                             // final report, as for a trace file
+
+    print_command(argc, argv);
+
+    simulator.print_output();
+
+    if(print_storage)
+    {
+        simulator.print_storage();
+    }
+
+    return 0;
+
+}
+
+
+
+bool take_option(int &argc, char* argv[], const char *option)     // remove every occurrence of a "--option" flag, true if it was given
+{
+
+    bool found = false;
+    int kept = 1;
+
+    for(int i = 1; i < argc; i++)
+    {
+        if(strcmp(argv[i], option) == 0)
+        {
+            found = true;
+        }
+        else
+        {
+            argv[kept++] = argv[i];
+        }
+    }
+
+    argc = kept;
+
+    return found;
+
+}
+
+
+const char *take_option_value(int &argc, char* argv[], const char *prefix)     // remove a "--option=value" flag, returns its value or NULL
+{
+
+    const char *value = NULL;
+    size_t prefix_len = strlen(prefix);
+    int kept = 1;
+
+    for(int i = 1; i < argc; i++)
+    {
+        if(strncmp(argv[i], prefix, prefix_len) == 0)
+        {
+            value = argv[i] + prefix_len;
+        }
+        else
+        {
+            argv[kept++] = argv[i];
+        }
+    }
+
+    argc = kept;
+
+    return value;
+
+}
+
+
+void take_counter_option(int &argc, char* argv[], const char *prefix, counter_params &counters, bool chooser)     // "--<table>-counter=<width>[,<init>[,<inc>,<dec>]]"
+{
+
+    const char *spec = take_option_value(argc, argv, prefix);
+    char *end = NULL;
+
+    counters.width = COUNTER_BITS;
+    counters.inc = 1;
+    counters.dec = 1;
+
+    if(spec != NULL)
+    {
+        counters.width = strtoul(spec, &end, 10);
+
+        if((counters.width < 1) || (counters.width > COUNTER_MAX_BITS))
+        {
+            printf("Error: Wrong counter configuration:%s%s\n", prefix, spec);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    counters.init = (1ul << (counters.width - 1)) - (chooser ? 1 : 0);     // weakly taken, or weakly bimodal for the chooser
+
+    if(spec == NULL)
+    {
+        return;
+    }
+
+    if(*end == ',')
+    {
+        counters.init = strtoul(end + 1, &end, 10);
+
+        if(*end == ',')
+        {
+            counters.inc = strtoul(end + 1, &end, 10);
+            counters.dec = (*end == ',') ? strtoul(end + 1, &end, 10) : 0;
+        }
+    }
+
+    unsigned long range = 1ul << counters.width;
+
+    if((*end != '\0') || (counters.init >= range) || (counters.inc < 1) || (counters.inc >= range) || (counters.dec < 1) || (counters.dec >= range))
+    {
+        printf("Error: Wrong counter configuration:%s%s\n", prefix, spec);
+        exit(EXIT_FAILURE);
+    }
+
+}
+
+
+unsigned long take_delay_option(int &argc, char* argv[])           // "--delay=<D>", 0 when not given
+{
+
+    const char *delay = take_option_value(argc, argv, "--delay=");
+    char *end = NULL;
+
+    if(delay == NULL)
+    {
+        return 0;
+    }
+
+    unsigned long value = strtoul(delay, &end, 10);
+
+    if((*delay < '0') || (*delay > '9') || (*end != '\0') || (value > MAX_DELAY))     // strtoul() would take "-1" as ULONG_MAX
+    {
+        printf("Error: Wrong delay:%s (0 to %lu)\n", delay, MAX_DELAY);
+        exit(EXIT_FAILURE);
+    }
+
+    return value;
+
+}
+
+
+/*  argc holds the number of command line arguments
+    argv[] holds the commands themselves
+
+    Example:-
+    sim bimodal 6 gcc_trace.txt
+    argc = 4
+    argv[0] = "sim"
+    argv[1] = "bimodal"
     argv[2] = "6"
     ... and so on
 */
 int main (int argc, char* argv[])
 {
-    FILE *FP;               // File handler
+    trace_reader reader;    // File handler
     char *trace_file;       // Variable that holds trace file name;
     bp_params params;       // look at sim_bp.h header file for the the definition of struct bp_params
-    char outcome;           // Variable holds branch outcome
-    unsigned long int addr; // Variable holds the address read from input file
+    predictor_kind kind;    // Which predictor params.bp_name names
     
+    bool print_storage = take_option(argc, argv, "--storage");     // report hardware bits and simulator memory
+
+    params.K = params.M1 = params.N = params.M2 = 0;
+    params.D = take_delay_option(argc, argv);                      // branches between a prediction and its table update
+
+    take_counter_option(argc, argv, "--bimodal-counter=", params.bimodal_counter, false);
+    take_counter_option(argc, argv, "--gshare-counter=", params.gshare_counter, false);
+    take_counter_option(argc, argv, "--chooser-counter=", params.chooser_counter, true);
+
+    if (argc >= 2 && strcmp(argv[1], "batch") == 0)         // Batch of traces, variable number of inputs
+    {
+        return run_batch(argc, argv, params, print_storage);
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "sweep") == 0)         // Design-space sweep within a storage budget
+    {
+        if(print_storage)
+        {
+            printf("Error: --storage does not apply to sweep, which lists the storage of every configuration\n");
+            exit(EXIT_FAILURE);
+        }
+
+        return run_sweep(argc, argv, params);
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "serve") == 0)         // Resident predictor fed over stdin or a socket
+    {
+        return run_server(argc, argv, params, print_storage);
+    }
+
     if (!(argc == 4 || argc == 5 || argc == 7))
     {
         printf("Error: Wrong number of inputs:%d\n", argc-1);
@@ -577,6 +2325,7 @@ int main (int argc, char* argv[])
         }
         params.M2       = strtoul(argv[2], NULL, 10);
         trace_file      = argv[3];
+        kind            = PREDICTOR_BIMODAL;
         printf("COMMAND\n%s %s %lu %s\n", argv[0], params.bp_name, params.M2, trace_file);
     }
     else if(strcmp(params.bp_name, "gshare") == 0)          // Gshare
@@ -589,6 +2338,7 @@ int main (int argc, char* argv[])
         params.M1       = strtoul(argv[2], NULL, 10);
         params.N        = strtoul(argv[3], NULL, 10);
         trace_file      = argv[4];
+        kind            = PREDICTOR_GSHARE;
         printf("COMMAND\n%s %s %lu %lu %s\n", argv[0], params.bp_name, params.M1, params.N, trace_file);
 
     }
@@ -604,172 +2354,46 @@ int main (int argc, char* argv[])
         params.N        = strtoul(argv[4], NULL, 10);
         params.M2       = strtoul(argv[5], NULL, 10);
         trace_file      = argv[6];
+        kind            = PREDICTOR_HYBRID;
         printf("COMMAND\n%s %s %lu %lu %lu %lu %s\n", argv[0], params.bp_name, params.K, params.M1, params.N, params.M2, trace_file);
 
     }
-    else
+    else if(strcmp(params.bp_name, "compress") == 0)        // Compress a trace file
     {
-        printf("Error: Wrong branch predictor name:%s\n", params.bp_name);
-        exit(EXIT_FAILURE);
-    }
-
-    // dynamic memory allocations
-
-    bimodal_branch_predictor *bimodal = nullptr;                    // bimodal pointer pointing to the "bimodal_branch_predictor" class
-    gshare_branch_predictor *gshare = nullptr;                      // ghare pointer pointing to the "gshare_branch_predcitor" class
-    hybrid_branch_predictor *hybrid = nullptr;                      // hybrid pointer pointing to the "hybrid_branch_predcitor" class
+        if(argc != 4)
+        {
+            printf("Error: %s wrong number of inputs:%d\n", params.bp_name, argc-1);
+            exit(EXIT_FAILURE);
+        }
+        trace_file      = argv[2];
+        printf("COMMAND\n%s %s %s %s\n", argv[0], params.bp_name, trace_file, argv[3]);
 
-    if(strcmp(params.bp_name, "bimodal") == 0)                      // bimodal
-    {
-        bimodal = new bimodal_branch_predictor(params.M2);          // call the constructor to initialize the branch history table
-    }
-    
-    if(strcmp(params.bp_name, "gshare") == 0)                       // gshare
-    {
-        gshare = new gshare_branch_predictor(params.M1);            // call the constructor to initialize the branch history table
+        return compress_trace_file(trace_file, argv[3]);
     }
-
-    if(strcmp(params.bp_name, "hybrid") == 0)                       // hybrid
+    else
     {
-        bimodal = new bimodal_branch_predictor(params.M2);                                // call the constructor to initialize the branch history table
-        gshare = new gshare_branch_predictor(params.M1);                                 // call the constructor to initialize the branch history table
-        hybrid = new hybrid_branch_predictor(params.K, params.M1, params.N, params.M2);  // call the constructor to initialize the branch history table
+        printf("Error: Wrong branch predictor name:%s\n", params.bp_name);
+        exit(EXIT_FAILURE);
     }
 
+    branch_simulator simulator(params, kind);               // allocate and initialize the branch history tables
 
-
-    // Open trace_file in read mode
-    FP = fopen(trace_file, "r");
-    if(FP == NULL)
+    // Open trace_file in read mode (plain text or compressed, see sim_bp.h)
+    if(!reader.open(trace_file))
     {
         // Throw error and exit if fopen() failed
         printf("Error: Unable to open file %s\n", trace_file);
         exit(EXIT_FAILURE);
     }
     
-    char str[2];
-    while(fscanf(FP, "%lx %s", &addr, str) != EOF)
-    {
-
-        outcome = str[0];
-
-        // if (outcome == 't')
-        //     printf("%lx %s\n", addr, "t");           // Print and test if file is read correctly
-        // else if (outcome == 'n')
-        //     printf("%lx %s\n", addr, "n");          // Print and test if file is read correctly
-        
-        /*************************************
-            Add branch predictor code here
-        **************************************/
-
-       if(strcmp(params.bp_name, "bimodal") == 0)            // bimodal branch predictor 
-       {
-
-            size_t m;
-
-            m = params.M2;                                      // number of PC bits used to index the bimodal table (M2)
-            
-            bimodal -> predict(addr,m);                         // start the prediction
-            bimodal -> update_branch_table(addr,m,outcome);     // update the bimodal branch table
-       }
-
-       if(strcmp(params.bp_name, "gshare") == 0)            // gshare branch predictor 
-       {
-
-            size_t m;
-            size_t n;
-
-            m = params.M1;                                         // number of PC bits used to index the gshare table (M1)
-            n = params.N;                                         // global branch history register bits
-            
-            gshare -> predict(addr,m,n);                         // start the prediction
-            gshare -> update_branch_table(addr,m,n,outcome);     // update the gshare branch table
-            gshare -> update_global_history(n,outcome);         // update the global history register after updating the branch table
-       }
+    simulator.run(reader);                                  // predict every branch, then commit the updates still in flight
 
-       if(strcmp(params.bp_name, "hybrid") == 0)             // hybrid branch predictor
-        {
-
-            size_t k,m1,n,m2;
-            prediction_stats m_stats;
-
-            k = params.K;
-            m1 = params.M1;
-            n = params.N;
-            m2 = params.M2;
-
-            char prediction_hybrid;
-
-            bimodal -> predict(addr,m2);
-            char prediction_bimodal = (bimodal -> get_bimodal_prediction());        // get the bimodal prediction
-            gshare -> predict(addr,m1,n);
-            char prediction_gshare = (gshare -> get_gshare_prediction());           // get the gshare prediction
-
-            if((hybrid -> select_predictor(addr,k,m1,n,m2,outcome)) == 1)         // select gshare predictor
-            {
-
-                prediction_hybrid = prediction_gshare;
-                gshare -> update_branch_table(addr,m1,n,outcome);
-                gshare -> update_global_history(n,outcome);
-
-
-            }
-
-            else 
-            {
-                prediction_hybrid = prediction_bimodal;                        // select bimodal predictor
-                bimodal -> update_branch_table(addr,m2,outcome);
-                gshare -> update_global_history(n,outcome);
-
-            }
-            
-            hybrid -> predict(outcome, prediction_hybrid);                                          // make a prediction
-
-            hybrid -> update_chooser_table(addr,k,prediction_gshare,prediction_bimodal,outcome);    // update the hybrid chooser table
-
-        }
+    simulator.print_output();
 
+    if(print_storage)
+    {
+        simulator.print_storage();
     }
-
-    if(strcmp(params.bp_name, "bimodal") == 0)
-       {
-
-            printf("OUTPUT\n");
-            printf(" number of predictions:    %zu\n", bimodal -> m_stats.m_predictions_bimodal);
-            printf(" number of mispredictions: %zu\n", bimodal -> m_stats.m_mispredictions_bimodal);
-            printf(" misprediction rate:       %0.2f%%\n", (double(bimodal -> m_stats.m_mispredictions_bimodal)/double(bimodal -> m_stats.m_predictions_bimodal)*100));
-            
-            bimodal -> print_bimodal_contents(params.M2);
-       }
-
-    if(strcmp(params.bp_name, "gshare") == 0)
-       {
-
-            printf("OUTPUT\n");
-            printf(" number of predictions:    %zu\n", gshare -> m_stats.m_predictions_gshare);
-            printf(" number of mispredictions: %zu\n", gshare -> m_stats.m_mispredictions_gshare);
-            printf(" misprediction rate:       %0.2f%%\n", (double(gshare -> m_stats.m_mispredictions_gshare)/double(gshare -> m_stats.m_predictions_gshare)*100));
-            
-           gshare -> print_gshare_contents(params.M1);
-       }
-
-    if(strcmp(params.bp_name, "hybrid") == 0)
-       {
-
-            printf("OUTPUT\n");
-            printf(" number of predictions:    %zu\n", hybrid -> m_stats.m_predictions_hybrid);
-            printf(" number of mispredictions: %zu\n", hybrid -> m_stats.m_mispredictions_hybrid);
-            printf(" misprediction rate:       %0.2f%%\n", (double(hybrid -> m_stats.m_mispredictions_hybrid)/double(hybrid -> m_stats.m_predictions_hybrid)*100));   
-
-            hybrid -> print_hybrid_contents(params.K);
-            gshare -> print_gshare_contents(params.M1);
-            bimodal -> print_bimodal_contents(params.M2);
-
-       }
-
-    delete bimodal;
-    delete gshare;
-    delete hybrid;
     
     return 0;
 }
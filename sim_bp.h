@@ -1,14 +1,103 @@
 #ifndef SIM_BP_H
 #define SIM_BP_H
 
+#include <stdint.h>
+
+// saturating counters of one table ("--bimodal-counter=<width>[,<init>[,<inc>,<dec>]]", likewise
+// --gshare-counter and --chooser-counter); a counter predicts taken (selects gshare) in the upper
+// half of its range, and different inc/dec steps give an asymmetric hysteresis
+
+typedef struct counter_params{
+    unsigned long int width;                // 1 to 4 bits
+    unsigned long int init;                 // initial value
+    unsigned long int inc;                  // step towards taken (chooser: towards gshare)
+    unsigned long int dec;                  // step towards not taken (chooser: towards bimodal)
+}counter_params;
+
 typedef struct bp_params{
     unsigned long int K;
     unsigned long int M1;
     unsigned long int M2;
     unsigned long int N;
+    unsigned long int D;                    // update delay: branches between a prediction and its table updates
+    counter_params    bimodal_counter;
+    counter_params    gshare_counter;
+    counter_params    chooser_counter;
     char*             bp_name;
 }bp_params;
 
 // Put additional data structures here as per your requirement
 
+// predictor selected by bp_name
+
+typedef enum predictor_kind{
+    PREDICTOR_BIMODAL,
+    PREDICTOR_GSHARE,
+    PREDICTOR_HYBRID
+}predictor_kind;
+
+#define COUNTER_BITS    2                   // default counter width
+#define COUNTER_MAX_BITS 4
+#define COUNTER_STEPPED  8                  // kernel flag added to the width: inc/dec other than 1, updated through a transition table
+
+// a predicted branch waiting for its table updates to commit (see branch_simulator)
+
+typedef struct pending_update{
+    uint32_t          bimodal_index;        // table indices computed at prediction time
+    uint32_t          gshare_index;
+    uint32_t          chooser_index;
+    uint8_t           taken;                // actual outcome
+    uint8_t           bimodal_taken;        // component predictions
+    uint8_t           gshare_taken;
+    uint8_t           sel_gshare;           // chooser selected gshare
+}pending_update;
+
+#define MAX_DELAY       (1ul << 16)         // largest --delay=<D>, bounds the ring of in-flight updates
+
+// one dynamic branch of a trace (also the 8-byte wire format of the server)
+
+typedef struct branch_record{
+    uint32_t          addr;
+    char              outcome;              // 't' or 'n'
+    uint8_t           pad[3];               // explicit, so the 8-byte wire layout does not rest on the ABI
+}branch_record;
+
+static_assert(sizeof(branch_record) == 8, "branch_record is the 8-byte server wire format");
+
+// server wire protocol ("sim serve ..."), native byte order: a stream of messages, each a
+// bp_message header optionally followed by its payload
+
+#define BP_MSG_BRANCHES     1               // followed by 'count' branch_records
+#define BP_MSG_STATS        2               // replied to with a bp_stats_reply
+#define BP_MSG_RESET        3               // reset the tables and statistics
+#define BP_MSG_SHUTDOWN     4               // print the final report and exit
+#define BP_SERVER_BUFFER    (1 << 20)       // read size; a multiple of sizeof(branch_record)
+
+typedef struct bp_message{
+    uint32_t          type;
+    uint32_t          count;
+}bp_message;
+
+typedef struct bp_stats_reply{
+    uint64_t          predictions;
+    uint64_t          mispredictions;
+}bp_stats_reply;
+
+// compressed trace format ("sim compress <trace_file> <out_file>")
+//
+// header: the 4 magic bytes below, followed by a stream of varint (LEB128) tokens
+//   literal: (addr << 2) | (taken << 1) | 0
+//   repeat:  ((period - 1) << 1) | 1, then count -> replay the last 'period' records 'count' times over
+//            (the copy may overlap itself, so a loop body repeated R times is a single token)
+//   end:     1, then 0, then the number of records in the trace; must be the last bytes of the file,
+//            so a file cut off anywhere (even at a token boundary) is reported as corrupt
+
+#define BPZ_MAGIC       "BPZ2"
+#define BPZ_MAGIC_V1    "BPZ1"              // earlier format without the end token, still readable
+#define BPZ_MAGIC_LEN   4
+#define BPZ_WINDOW      1024                // longest loop body the encoder looks back over (power of 2)
+#define BPZ_BUFFER      (1 << 16)           // read/write block size for compressed traces
+#define BPZ_RING        (1 << 16)           // records the encoder holds: the window plus its lookahead (power of 2)
+#define BPZ_HASH_BITS   16                  // encoder hash table of the newest position of each record
+
 #endif